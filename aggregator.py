@@ -0,0 +1,261 @@
+import math
+from collections import OrderedDict, deque
+
+class QuantileSketch:
+    """
+    Compact sketch of a distribution (logarithmic buckets, as DDSketch):
+    quantiles have a bounded relative error and the memory is bounded by max_bins
+    """
+
+    def __init__(self, relative_accuracy=0.02, max_bins=128):
+        self.relative_accuracy = relative_accuracy
+        self.max_bins = max_bins
+        self.gamma = (1 + relative_accuracy) / (1 - relative_accuracy)
+        self.log_gamma = math.log(self.gamma)
+        self.bins = {}        # bucket index -> count
+        self.zero_count = 0   # values <= 0 (no logarithm)
+        self.count = 0
+
+    def add(self, value, count=1):
+        """
+        Add a value to the sketch
+
+        Parameters
+        ----------
+        value -- value to add (int or float)
+        count -- number of times the value is added (int)
+        """
+        self.count += count
+        if value <= 0:
+            self.zero_count += count
+            return
+        index = math.ceil(math.log(value) / self.log_gamma)
+        self.bins[index] = self.bins.get(index, 0) + count
+        self._collapse()
+
+    def merge(self, other):
+        """
+        Add all the values of another sketch (same accuracy) to this one
+        """
+        self.count += other.count
+        self.zero_count += other.zero_count
+        for index, count in other.bins.items():
+            self.bins[index] = self.bins.get(index, 0) + count
+        self._collapse()
+
+    def quantile(self, q):
+        """
+        Return the estimated value at quantile q (between 0 and 1), None if the sketch is empty
+        """
+        if self.count == 0:
+            return None
+        rank = q * (self.count - 1)
+        seen = self.zero_count
+        if rank < seen:
+            return 0
+        for index in sorted(self.bins):
+            seen += self.bins[index]
+            if rank < seen:
+                return 2 * self.gamma ** index / (self.gamma + 1)
+        return 2 * self.gamma ** max(self.bins) / (self.gamma + 1)
+
+    def _collapse(self):
+        # Too many buckets: the lowest ones are merged (the error stays bounded on the high quantiles)
+        while len(self.bins) > self.max_bins:
+            lowest, second = sorted(self.bins)[:2]
+            self.bins[second] += self.bins.pop(lowest)
+
+class WindowStats:
+    """
+    Statistics of the values of one window: count, sum, min, max and a quantile sketch
+    """
+
+    def __init__(self, relative_accuracy=0.02, max_bins=128):
+        self.count = 0
+        self.sum = 0
+        self.min = None
+        self.max = None
+        self.sketch = QuantileSketch(relative_accuracy, max_bins)
+
+    def add(self, value):
+        self.count += 1
+        self.sum += value
+        self.min = value if self.min is None else min(self.min, value)
+        self.max = value if self.max is None else max(self.max, value)
+        self.sketch.add(value)
+
+    def quantile(self, q):
+        """
+        Return the estimated value at quantile q, kept between the exact min and max
+        """
+        value = self.sketch.quantile(q)
+        return None if value is None else min(max(value, self.min), self.max)
+
+    def merge(self, other):
+        if other.count == 0:
+            return
+        self.count += other.count
+        self.sum += other.sum
+        self.min = other.min if self.min is None else min(self.min, other.min)
+        self.max = other.max if self.max is None else max(self.max, other.max)
+        self.sketch.merge(other.sketch)
+
+class WindowedSeries:
+    """
+    Values of one key (node, coordinator or whole network), kept in tumbling buckets of window seconds.
+    The sliding window is the merge of the buckets of the last nb_buckets windows, older buckets are dropped.
+    """
+
+    def __init__(self, window, nb_buckets, relative_accuracy, max_bins):
+        self.window = window
+        self.relative_accuracy = relative_accuracy
+        self.max_bins = max_bins
+        self.buckets = deque(maxlen=nb_buckets)  # (start time, WindowStats), oldest first
+
+    def add(self, timestamp, value):
+        """
+        Add a value received at timestamp (seconds)
+        """
+        start = timestamp - timestamp % self.window
+        if not self.buckets or self.buckets[-1][0] < start:
+            self.buckets.append((start, WindowStats(self.relative_accuracy, self.max_bins)))
+        for bucket_start, stats in reversed(self.buckets):
+            if bucket_start == start:
+                stats.add(value)
+                return
+        # Older than every bucket kept: dropped
+
+    def last_update(self):
+        return self.buckets[-1][0] if self.buckets else None
+
+    def tumbling(self, start):
+        """
+        Return the WindowStats of the bucket beginning at start (empty if there was no value)
+        """
+        for bucket_start, stats in self.buckets:
+            if bucket_start == start:
+                return stats
+        return WindowStats(self.relative_accuracy, self.max_bins)
+
+    def sliding(self, end):
+        """
+        Return the WindowStats of the buckets which begin in the nb_buckets windows before end
+        (the deque keeps the last non-empty buckets, which may be much older)
+        """
+        merged = WindowStats(self.relative_accuracy, self.max_bins)
+        begin = end - self.buckets.maxlen * self.window
+        for bucket_start, stats in self.buckets:
+            if begin <= bucket_start < end:
+                merged.merge(stats)
+        return merged
+
+class Aggregator:
+    """
+    Incremental aggregation of the readings, per node, per coordinator and for the whole network.
+    The memory is bounded: max_keys series (the least recently updated are evicted),
+    sliding / window buckets per series and max_bins buckets per sketch.
+    """
+
+    NETWORK = ("network", "*")
+
+    def __init__(self, window=60, sliding=300, max_keys=10000, relative_accuracy=0.02, max_bins=128):
+        """
+        Parameters
+        ----------
+        window -- length of the tumbling windows in seconds (int)
+        sliding -- length of the sliding window in seconds, multiple of window (int)
+        max_keys -- maximum number of series kept in memory (int)
+        relative_accuracy -- relative error of the percentiles (float)
+        max_bins -- maximum number of buckets of a sketch (int)
+        """
+        self.window = window
+        self.sliding = sliding
+        self.nb_buckets = max(1, sliding // window)
+        self.max_keys = max_keys
+        self.relative_accuracy = relative_accuracy
+        self.max_bins = max_bins
+        self.series = OrderedDict()  # (kind, id) -> WindowedSeries, least recently updated first
+
+    def add(self, timestamp, node_id, value, coordinator=None):
+        """
+        Add a reading to the series of its node, of its coordinator and of the network
+
+        Parameters
+        ----------
+        timestamp -- reception time in seconds (float)
+        node_id -- id of the node which sent the reading (str)
+        value -- value of the reading (int)
+        coordinator -- link address of the coordinator it went through, None if unknown (str)
+        """
+        keys = [("node", node_id), self.NETWORK]
+        if coordinator is not None:
+            keys.append(("coordinator", coordinator))
+        for key in keys:
+            self._get_series(key).add(int(timestamp), value)
+
+    def window_start(self, timestamp):
+        """
+        Return the beginning of the tumbling window containing timestamp
+        """
+        return int(timestamp) - int(timestamp) % self.window
+
+    def summaries(self, start, kinds=("network", "coordinator")):
+        """
+        Summaries of the tumbling window beginning at start, and of the sliding window ending with it
+
+        Parameters
+        ----------
+        start -- beginning of the tumbling window (int)
+        kinds -- kinds of series to summarize ("network", "coordinator" and/or "node") (tuple)
+
+        Returns
+        -------
+        list of (key, tumbling WindowStats, sliding WindowStats), sorted by key
+        """
+        self._expire(start)
+        result = []
+        for key in sorted(k for k in self.series if k[0] in kinds):
+            series = self.series[key]
+            result.append((key, series.tumbling(start), series.sliding(start + self.window)))
+        return result
+
+    def format_summary(self, key, tumbling, sliding):
+        """
+        Return one line summarizing a series
+        """
+        def describe(stats, length):
+            if stats.count == 0:
+                return "count 0"
+            return (f"count {stats.count} sum {stats.sum} min {stats.min} max {stats.max} "
+                    f"rate {stats.count / length:.2f}/s "
+                    f"p50 {stats.quantile(0.5):.0f} p90 {stats.quantile(0.9):.0f} "
+                    f"p99 {stats.quantile(0.99):.0f}")
+
+        kind, key_id = key
+        return (f"{kind.capitalize()} {key_id} -- last {self.window}s: {describe(tumbling, self.window)}"
+                f" | last {self.nb_buckets * self.window}s: {describe(sliding, self.nb_buckets * self.window)}")
+
+    def _get_series(self, key):
+        series = self.series.get(key)
+        if series is None:
+            series = WindowedSeries(self.window, self.nb_buckets, self.relative_accuracy, self.max_bins)
+            self.series[key] = series
+            while len(self.series) > self.max_keys:
+                oldest = next(iter(self.series))
+                if oldest == self.NETWORK:
+                    self.series.move_to_end(oldest)
+                    oldest = next(iter(self.series))
+                del self.series[oldest]
+        else:
+            self.series.move_to_end(key)
+        return series
+
+    def _expire(self, start):
+        # Series without value in the whole sliding window are not needed anymore
+        limit = start - (self.nb_buckets - 1) * self.window
+        while self.series:
+            key, series = next(iter(self.series.items()))
+            if series.last_update() is None or series.last_update() < limit:
+                del self.series[key]
+            else:
+                break
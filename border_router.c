@@ -2,13 +2,18 @@
 #include "net/netstack.h"
 #include "net/nullnet/nullnet.h"
 #include "net/packetbuf.h"
-#include "realloc.h"
+#include "command.h"
+#include "forward.h"
+#include "join.h"
 
 #include "sys/clock.h"
+#include "dev/serial-line.h"
+#include "dev/uart0.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 
 #include "sys/node-id.h"
@@ -21,17 +26,32 @@
 
 /* OTHER CONFIGURATION */
 #define BERKELEY_INTERVAL (5 * CLOCK_SECOND)
+#define BERKELEY_STAGGER (CLOCK_SECOND / 32) // delay between two clock requests, so the answers don't collide
+#define BERKELEY_TIMEOUT (CLOCK_SECOND / 2)  // time to wait for the answers after the last request
+#define BERKELEY_MAX_MISSED 3                // rounds without answer before a coordinator is removed
 #define TIME_WINDOW (2 * CLOCK_SECOND)
+#define TIMESLOT_MIN (CLOCK_SECOND / 8)      // shortest timeslot, the time window is made longer if needed
+
+#ifdef BORDER_ROUTER_CONF_MAX_CHILDREN
+#define MAX_CHILDREN BORDER_ROUTER_CONF_MAX_CHILDREN
+#else
+#define MAX_CHILDREN 32
+#endif
+
+#define NO_SHORT_ID 0xFF // short ID of a coordinator which didn't receive one yet
 
 //-------------------------------------
 
 static int in_network = 0; // Says if the node is already connected to the network ()
 
-// ROUTING TABLE
-typedef struct node {
-  linkaddr_t *children;
-  uint16_t nb_children;
-} node_t;
+// COORDINATOR TABLE, indexed by the short ID of the coordinator (given with its timeslot)
+typedef struct coordinator {
+  linkaddr_t addr;
+  uint8_t active;         // 1 if the entry is used
+  uint8_t replied;        // 1 if it answered the current Berkeley round
+  uint8_t missed_rounds;  // number of rounds in a row without answer
+  long int clock_offset;  // coordinator clock - my clock, measured when its answer arrives
+} coordinator_t;
 
 typedef struct data_structure{
   uint8_t step_signal;
@@ -39,77 +59,185 @@ typedef struct data_structure{
   uint8_t data [2];
   clock_time_t clock;
   clock_time_t timeslot_array [2];
+  clock_time_t time_window; // length of the schedule, sent with the timeslot (SGN 9)
 }data_structure_t;
 
-static node_t my_node = { 
-  .children = NULL,
-  .nb_children = 0 
-};
+PROJECT_STATIC_ASSERT(sizeof(data_structure_t) <= FRAME_MAX_PAYLOAD, data_frame_length);
+PROJECT_STATIC_ASSERT(sizeof(command_structure_t) <= FRAME_MAX_PAYLOAD, command_frame_length);
+PROJECT_STATIC_ASSERT(offsetof(data_structure_t, node_rank) == offsetof(frame_header_t, node_rank), data_frame_header);
+PROJECT_STATIC_ASSERT(MAX_CHILDREN < NO_SHORT_ID, short_id_range);
+// A round (staggered clock requests, timeout, staggered timeslots) must end before the next one starts
+PROJECT_STATIC_ASSERT(2 * MAX_CHILDREN * BERKELEY_STAGGER + BERKELEY_TIMEOUT < BERKELEY_INTERVAL, berkeley_round_fits);
+
+static coordinator_t coordinators[MAX_CHILDREN];
+static uint8_t nb_coordinators = 0;
 
 static data_structure_t data_to_send ={
   .node_rank = 0,
-  .clock = 0
+  .clock = 0,
+  .time_window = TIME_WINDOW
 };
+static clock_time_t time_window = TIME_WINDOW; // asked by the server (the schedule sent may be longer, see TIMESLOT_MIN)
 
 static struct ctimer berkeley_timer;
-static int clock_compensation = 0;
-static clock_time_t *clock_array;
-static size_t clock_array_size = 0;
+static struct ctimer round_timer; // staggered requests, end of the round, then staggered timeslots
+static long int clock_compensation = 0;
+static uint8_t round_open = 0;
+static uint8_t next_request = 0;  // short ID of the next coordinator to ask for its clock
+static uint8_t nb_replies = 0;
+static uint8_t next_timeslot = 0; // short ID of the next coordinator to receive its timeslot
+static uint8_t nb_slots = 0;      // timeslots of the schedule being sent
+static uint8_t slot = 0;          // next timeslot to give
+static clock_time_t schedule_start = 0;
+static clock_time_t timeslot = 0;
+static command_config_t pending_config; // parameters received from the server, applied on the next synchronization
+
+/* Return the short ID of a coordinator from its address, NO_SHORT_ID if unknown */
+static uint8_t find_coordinator(const linkaddr_t *addr){
+  for(uint8_t i = 0; i < MAX_CHILDREN; i++){
+    if(coordinators[i].active && linkaddr_cmp(&coordinators[i].addr, addr)){
+      return i;
+    }
+  }
+  return NO_SHORT_ID;
+}
 
-void add_child(node_t *n, linkaddr_t child) {
-  if(n->nb_children == 0){
-    n->children = (linkaddr_t *) malloc(sizeof(linkaddr_t));
+/* Add a coordinator to the table, return its short ID (NO_SHORT_ID if there is no room for it) */
+static uint8_t add_coordinator(const linkaddr_t *addr){
+  uint8_t id = find_coordinator(addr);
+  if(id != NO_SHORT_ID){
+    return id;  // it joined again, keep its short ID
   }
-  else{
-    // Allocate memory for one additional child
-    n->children = realloc(n->children, (n->nb_children + 1) * sizeof(linkaddr_t));
+  for(id = 0; id < MAX_CHILDREN; id++){
+    if(!coordinators[id].active){
+      linkaddr_copy(&coordinators[id].addr, addr);
+      coordinators[id].active = 1;
+      coordinators[id].replied = 0;
+      coordinators[id].missed_rounds = 0;
+      nb_coordinators++;
+      return id;
+    }
   }
-  // Copy the new child's address into the new memory location
-  linkaddr_copy(&n->children[n->nb_children], &child);
-  n->nb_children++;
+  return NO_SHORT_ID;
 }
 
-long int handle_clock(clock_time_t received_clock){
-  
-  if(clock_array_size == 0){
-    clock_array = (clock_time_t*) malloc(sizeof(clock_time_t));
+static void remove_coordinator(uint8_t id){
+  LOG_INFO("Coordinator %u not reachable anymore\n", id);
+  // If it is still alive, it must stop polling in its timeslot (given to another coordinator) and join again.
+  // If this message is lost, the coordinator gives up its timeslot by itself when it doesn't receive a new one
+  data_to_send.step_signal = 3;
+  NETSTACK_NETWORK.output(&coordinators[id].addr);
+  coordinators[id].active = 0;
+  route_forget(&coordinators[id].addr);
+  nb_coordinators--;
+}
+
+/* Send the synchronized clock and its timeslot (SGN 9) to one coordinator, the next one BERKELEY_STAGGER later.
+   Sending them all at once would overflow the MAC queue above a few coordinators
+*/
+static void send_next_timeslot(void* ptr){
+  while(next_timeslot < MAX_CHILDREN && !coordinators[next_timeslot].active){
+    next_timeslot++;
   }
-  else{
-    clock_array = realloc(clock_array, (clock_array_size+1)*sizeof(clock_time_t));
+  if(next_timeslot >= MAX_CHILDREN || slot >= nb_slots){  // slot >= nb_slots: joined after the schedule was computed
+    return;
   }
-  clock_array[clock_array_size] = received_clock;
-  clock_array_size+=1;
+  data_to_send.clock = clock_time() + clock_compensation;
+  data_to_send.data[0] = next_timeslot; // the coordinator gives back its short ID in its next clock answer
+  data_to_send.timeslot_array[0] = schedule_start + slot*timeslot + timeslot/10;  // timeslot/10 is a guardtime
+  data_to_send.timeslot_array[1] = schedule_start + (slot+1)*timeslot;
+  data_to_send.step_signal = 9;
+  LOG_DBG("Timeslot %u to coordinator %u\n", slot, next_timeslot);
+  NETSTACK_NETWORK.output(&(coordinators[next_timeslot].addr));
+  next_timeslot++;
+  slot++;
+  ctimer_set(&round_timer, BERKELEY_STAGGER, send_next_timeslot, NULL);
+}
 
-  if(clock_array_size == my_node.nb_children){
-    long int num = 0;
-  
-    for(int i=0; i<clock_array_size; i++){
-      num += (clock_time() - clock_array[i]);
-    }
-    clock_compensation = num / clock_array_size;
+/* Share the time window between the coordinators: one message per coordinator and per round */
+static void timeslots_allocation(){
+  if(nb_coordinators == 0){
+    return;
+  }
+  nb_slots = nb_coordinators;
+  timeslot = time_window / nb_slots;
+  if(timeslot < TIMESLOT_MIN){ // too short to poll the sensors: the schedule is longer than the time window asked
+    timeslot = TIMESLOT_MIN;
+  }
+  data_to_send.time_window = time_window > nb_slots * timeslot ? time_window : nb_slots * timeslot;
+  // The schedule starts once every coordinator has its timeslot
+  schedule_start = clock_time() + clock_compensation + nb_slots * BERKELEY_STAGGER;
+  slot = 0;
+  next_timeslot = 0;
+  send_next_timeslot(NULL);
+}
 
-    long int synchronized_clock = clock_time() - clock_compensation; 
+/* End of a Berkeley round: average the offsets of the answers, then give the clock with the timeslots */
+static void close_round(void* ptr){
+  if(!round_open){
+    return;
+  }
+  round_open = 0;
+  ctimer_stop(&round_timer);
 
-    free(clock_array);
-    clock_array_size = 0;
-    
-    return synchronized_clock;
+  long int num = 0;
+  for(uint8_t i = 0; i < MAX_CHILDREN; i++){
+    if(!coordinators[i].active){
+      continue;
+    }
+    if(coordinators[i].replied){
+      num += coordinators[i].clock_offset;
+    }
+    else if(++coordinators[i].missed_rounds >= BERKELEY_MAX_MISSED){
+      remove_coordinator(i);
+    }
+  }
+  if(nb_replies > 0){
+    clock_compensation = num / nb_replies;
   }
+  LOG_DBG("Berkeley round closed: %u answers, compensation %ld\n", nb_replies, clock_compensation);
+  timeslots_allocation();
+}
 
-  return 0;
+/* Ask the clock of one coordinator, the next one is asked BERKELEY_STAGGER later */
+static void send_next_clock_request(void* ptr){
+  while(next_request < MAX_CHILDREN && !coordinators[next_request].active){
+    next_request++;
+  }
+  if(next_request >= MAX_CHILDREN){
+    ctimer_set(&round_timer, BERKELEY_TIMEOUT, close_round, NULL);  // every coordinator has been asked
+    return;
+  }
+  data_to_send.step_signal = 6;
+  LOG_DBG("Clock request to coordinator %u\n", next_request);
+  NETSTACK_NETWORK.output(&(coordinators[next_request].addr));
+  next_request++;
+  ctimer_set(&round_timer, BERKELEY_STAGGER, send_next_clock_request, NULL);
 }
 
-void timeslots_allocation(){
- if(my_node.nb_children > 0){
-    int timeslot = TIME_WINDOW/my_node.nb_children;
+/* Save the answer of a coordinator (SGN 7), return 1 if every coordinator answered */
+static int handle_clock(const linkaddr_t *src, uint8_t id, clock_time_t received_clock){
+  if(id >= MAX_CHILDREN || !coordinators[id].active || !linkaddr_cmp(&coordinators[id].addr, src)){
+    id = find_coordinator(src);  // no short ID yet (or an old one)
+  }
+  if(!round_open || id == NO_SHORT_ID || coordinators[id].replied){
+    return 0;
+  }
+  coordinators[id].clock_offset = (long int) received_clock - (long int) clock_time();
+  coordinators[id].replied = 1;
+  coordinators[id].missed_rounds = 0;
+  nb_replies++;
+  return nb_replies == nb_coordinators;
+}
 
-    for (int i=0; i< my_node.nb_children; i++){
-      clock_time_t synchronized_clock = clock_time() + clock_compensation;
-      data_to_send.timeslot_array[0] = synchronized_clock + i*timeslot + TIME_WINDOW/20;  // TIME_WINDOW/20 is a guardtime
-      data_to_send.timeslot_array[1] = synchronized_clock + (i+1)*timeslot;
-      data_to_send.step_signal = 9;
-      NETSTACK_NETWORK.output(&(my_node.children[i]));
-    }
+/* CONNECTION RESPONSE (SGN 1), called by the join module once the response delay is over */
+static void send_connection_response(const linkaddr_t *dest){
+  if(nb_coordinators < MAX_CHILDREN || find_coordinator(dest) != NO_SHORT_ID){ // things may have changed during the delay
+    LOG_DBG("SGN 1 (connexion response) send to ");
+    LOG_DBG_LLADDR(dest);
+    LOG_DBG_("\n");
+    data_to_send.step_signal = 1;
+    NETSTACK_NETWORK.output(dest);
   }
 }
 
@@ -124,51 +252,113 @@ void input_callback(const void *data, uint16_t len,
     linkaddr_t src_copy;  // Need to do a copy, to prevent problems if src is changing during the execution
     linkaddr_copy(&src_copy, src);
     data_structure_t *data_receive = (data_structure_t *) data; // Cast the data to data_structure_t
-    if(data_receive->step_signal == 0 && data_receive->node_rank == 1){ // CONNECTION REQUEST from coordinators
+    if(data_receive->step_signal == 0 && data_receive->node_rank == 1
+       && (nb_coordinators < MAX_CHILDREN || find_coordinator(&src_copy) != NO_SHORT_ID)){ // CONNECTION REQUEST from coordinators (only if there is room for a new child, or if it joins again)
         LOG_DBG("SGN 0 (connexion request) received from ");
         LOG_DBG_LLADDR(&src_copy);
-        data_to_send.step_signal = 1; // Send a connection response
-        LOG_DBG_(" ; SGN 1 (connexion response) send to ");
-        LOG_DBG_LLADDR(&src_copy);
-        LOG_DBG_("\n");
-        NETSTACK_NETWORK.output(&src_copy);
+        LOG_DBG_(" ; SGN 1 (connexion response) scheduled\n");
+        join_schedule_response(&src_copy, data_to_send.node_rank); // Send a connection response after a short random delay
     }
     else if(data_receive->step_signal == 2){  // ACKNOWLEDGE CONNECTION
         LOG_DBG("SGN 2 (ACK) received from ");
         LOG_DBG_LLADDR(&src_copy);
         LOG_DBG_(" which is now my child\n");
-        add_child(&my_node, src_copy);  //add the child to the list of children
+        if(add_coordinator(&src_copy) == NO_SHORT_ID){  //add the child to the coordinator table
+          LOG_WARN("No room for a new coordinator (MAX_CHILDREN = %u), SGN 3 sent\n", MAX_CHILDREN);
+          data_to_send.step_signal = 3;  // so it joins again instead of believing it's connected
+          NETSTACK_NETWORK.output(&src_copy);
+        }
     }
     else if(data_receive->step_signal == 7){  //MANAGE CLOCK BERKELEY
-      long int synchronized_clock = handle_clock(data_receive->clock);
-      if (synchronized_clock != 0){
-        data_to_send.clock = synchronized_clock;
-        for (int i = 0; i < my_node.nb_children; i++) {
-          data_to_send.step_signal = 8;
-          NETSTACK_NETWORK.output(&(my_node.children[i]));
-        }
+      if(handle_clock(&src_copy, data_receive->data[0], data_receive->clock)){
+        close_round(NULL);  // no need to wait for the timeout
       }
-      timeslots_allocation();
     }
     else if(data_receive->step_signal == 12){
-      data_to_send.data[0] = data_receive->data[0];
-      data_to_send.data[1] = data_receive->data[1];
-      LOG_INFO("RECEIVE DATA FROM NODE %d : %d\n", data_to_send.data[0], data_to_send.data[1]);
-      printf("magic2023-%d,%d\n",data_to_send.data[0], data_to_send.data[1]); //Send data to the server
+      if(find_coordinator(&src_copy) == NO_SHORT_ID){
+        add_coordinator(&src_copy);  // removed after missed rounds but still alive: give it back a timeslot
+      }
+      route_learn(data_receive->data[0], &src_copy); // downward route to the origin of the data
+      LOG_INFO("RECEIVE DATA FROM NODE %d : %d\n", data_receive->data[0], data_receive->data[1]);
+      // Send data to the server, with the link address of the coordinator it went through
+      // (not its short ID, which is given to another coordinator when it is removed)
+      printf("magic2023-%d,%d,",data_receive->data[0], data_receive->data[1]);
+      for(uint8_t i = 0; i < LINKADDR_SIZE; i++){
+        printf(i == 0 ? "%02x" : ":%02x", src_copy.u8[i]);
+      }
+      printf("\n");
     }
 }
 
+/* Parse a command line of the server ("magic2023-cmd,<target>,<param>,<value>")
+   and send it down the tree
+*/
+static void handle_server_command(const char *line){
+  command_structure_t command;
+  char *end;
+
+  if(strncmp(line, "magic2023-cmd,", 14) != 0){
+    return;
+  }
+  line += 14;
+  long target = strtol(line, &end, 10);
+  if(*end != ','){
+    return;
+  }
+  long param = strtol(end + 1, &end, 10);
+  if(*end != ','){
+    return;
+  }
+  long value = strtol(end + 1, &end, 10);
+  if(target < 0 || target > 255 || param <= 0 || param > 255 || value < 0 || value > 0xFFFF
+     || ((param == CMD_TRAFFIC_MODEL || param == CMD_TRAFFIC_PARAM) && value > 255)){  // 8-bit parameters of the nodes
+    LOG_WARN("Invalid command from the server\n");
+    return;
+  }
+
+  command.step_signal = 13;
+  command.node_rank = data_to_send.node_rank;
+  command.target = (uint8_t) target;
+  command.param = (uint8_t) param;
+  command.value = (uint16_t) value;
+  LOG_INFO("Command %u = %u for node %u\n", command.param, command.value, command.target);
+
+  if(command.param == CMD_TIME_WINDOW){
+    // The time window is shared by the whole network, the border router gives it with the timeslots
+    command_stage(&pending_config, &command);
+    return;
+  }
+  const linkaddr_t *next_hop = route_lookup(command.target);
+  if(next_hop != NULL){
+    command_output(&command, next_hop);
+  }
+  else{ // Broadcast command or unknown route: send it to every coordinator
+    for (uint8_t i = 0; i < MAX_CHILDREN; i++) {
+      if(coordinators[i].active){
+        command_output(&command, &(coordinators[i].addr));
+      }
+    }
+  }
+}
+
 static void send_clock_request(void* ptr){
   ctimer_reset(&berkeley_timer);
 
-  data_to_send.step_signal = 6;
-  LOG_DBG("I'm sending clock request %u to my children : ", data_to_send.step_signal);
-  for (int i = 0; i < my_node.nb_children; i++) {
-    LOG_DBG_LLADDR(&(my_node.children[i]));
-    LOG_DBG_(" ; ");
-    NETSTACK_NETWORK.output(&(my_node.children[i]));  // Use to sent data to the destination
+  // A synchronization round is the schedule boundary of the border router
+  if(COMMAND_PENDING(&pending_config, CMD_TIME_WINDOW) && pending_config.time_window > 0){
+    time_window = pending_config.time_window;
+    LOG_INFO("New time window %lu\n", time_window);
+  }
+  pending_config.mask = 0;
+
+  close_round(NULL); // in case the previous round is still waiting for answers
+  for(uint8_t i = 0; i < MAX_CHILDREN; i++){
+    coordinators[i].replied = 0;
   }
-  LOG_DBG_("\n");
+  nb_replies = 0;
+  next_request = 0;
+  round_open = 1;
+  send_next_clock_request(NULL);  // the requests are staggered, so the answers don't all arrive at once
 }
 
 /* MAIN PART PROCESS CODE */
@@ -187,9 +377,17 @@ PROCESS_THREAD(border_router_process, ev, data)
   nullnet_len = sizeof(data_structure_t);
   nullnet_set_input_callback(input_callback);
 
+  /* Initialize the serial line, to receive the commands of the server */
+  uart0_set_input(serial_line_input_byte);
+  serial_line_init();
+
+  join_init(node_id, send_connection_response);
   ctimer_set(&berkeley_timer, BERKELEY_INTERVAL, send_clock_request , NULL);
   while (1) {
     PROCESS_WAIT_EVENT();
+    if(ev == serial_line_event_message){
+      handle_server_command((const char *) data);
+    }
   }
 
   PROCESS_END();
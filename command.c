@@ -0,0 +1,109 @@
+// DOWNLINK CONTROL CHANNEL: staging of the commands and downward routes learned from the uplink
+#include "command.h"
+#include "forward.h"
+#include "sys/node-id.h"
+
+/* LOG CONFIGURATION */
+#include "sys/log.h"
+#define LOG_MODULE "App"
+#define LOG_LEVEL LOG_LEVEL_INFO
+
+typedef struct route{
+  uint8_t node;         // node_id of the origin of the data (0 if the entry is free)
+  linkaddr_t next_hop;  // child from which the data arrived
+}route_t;
+
+static route_t routes[ROUTE_TABLE_SIZE];
+static uint8_t next_victim = 0; // entry replaced when the table is full
+
+/* Keep a parameter until the node reaches its schedule boundary */
+void command_stage(command_config_t *cfg, const command_structure_t *cmd){
+  switch(cmd->param){
+    case CMD_TRAFFIC_MODEL:
+      cfg->traffic_model = (uint8_t) cmd->value;
+      break;
+    case CMD_TRAFFIC_PARAM:
+      cfg->traffic_param = (uint8_t) cmd->value;
+      break;
+    case CMD_TIME_WINDOW:
+      cfg->time_window = (clock_time_t) cmd->value * CLOCK_SECOND / 1000;
+      break;
+    case CMD_KEEPALIVE:
+      cfg->keepalive = (clock_time_t) cmd->value * CLOCK_SECOND / 1000;
+      break;
+    default:
+      return; // unknown parameter
+  }
+  cfg->mask |= 1 << cmd->param;
+}
+
+/* Send a command frame without touching the application buffer of the node */
+void command_output(const command_structure_t *cmd, const linkaddr_t *dest){
+  frame_output(cmd, sizeof(command_structure_t), dest);
+}
+
+/* Handle a command received from the parent (SGN 13, at least sizeof(command_structure_t) bytes):
+   stage it if it is for this node, and relay it as it is towards its target
+   (to the child leading to it, or to every child for a broadcast or an unknown route)
+*/
+void command_relay(const void *data, uint16_t len, int node_rank,
+                   const linkaddr_t *children, uint16_t nb_children, command_config_t *cfg){
+  const command_structure_t *command = (const command_structure_t *) data;
+  LOG_DBG("SGN 13 (command %u = %u) for node %u\n", command->param, command->value, command->target);
+  if(command->target == 0 || command->target == (uint8_t) node_id){
+    command_stage(cfg, command);
+  }
+  if(command->target != (uint8_t) node_id){
+    const linkaddr_t *next_hop = route_lookup(command->target);
+    if(!forward_prepare(data, len, node_rank)){ // command is not valid anymore after the first output
+      LOG_WARN("Command of %u bytes too big to be forwarded (FORWARD_BUF_SIZE = %u)\n", len, FORWARD_BUF_SIZE);
+    }
+    else if(next_hop != NULL){
+      forward_send(next_hop);
+    }
+    else{ // Broadcast command or unknown route: send it to the whole subtree
+      for (uint16_t i = 0; i < nb_children; i++) {
+        forward_send(&children[i]);
+      }
+    }
+  }
+}
+
+/* Save (or refresh) the child to use to reach node */
+void route_learn(uint8_t node, const linkaddr_t *next_hop){
+  int free_entry = -1;
+  for(int i = 0; i < ROUTE_TABLE_SIZE; i++){
+    if(routes[i].node == node){
+      linkaddr_copy(&routes[i].next_hop, next_hop);
+      return;
+    }
+    if(routes[i].node == 0 && free_entry == -1){
+      free_entry = i;
+    }
+  }
+  if(free_entry == -1){
+    free_entry = next_victim;
+    next_victim = (next_victim + 1) % ROUTE_TABLE_SIZE;
+  }
+  routes[free_entry].node = node;
+  linkaddr_copy(&routes[free_entry].next_hop, next_hop);
+}
+
+/* Return the child leading to node, NULL if unknown */
+const linkaddr_t *route_lookup(uint8_t node){
+  for(int i = 0; i < ROUTE_TABLE_SIZE; i++){
+    if(node != 0 && routes[i].node == node){
+      return &routes[i].next_hop;
+    }
+  }
+  return NULL;
+}
+
+/* Remove every route going through a child that left */
+void route_forget(const linkaddr_t *next_hop){
+  for(int i = 0; i < ROUTE_TABLE_SIZE; i++){
+    if(routes[i].node != 0 && linkaddr_cmp(&routes[i].next_hop, next_hop)){
+      routes[i].node = 0;
+    }
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef H_command
+#define H_command
+#include "contiki.h"
+#include "net/linkaddr.h"
+
+/* DOWNLINK COMMANDS
+   The server sends "magic2023-cmd,<target>,<param>,<value>" on the serial line of the border router,
+   which sends a SGN 13 frame down the tree. Target 0 means every node.
+*/
+#define CMD_TRAFFIC_MODEL 1 // value = TRAFFIC_MODEL_* (see traffic.h)
+#define CMD_TRAFFIC_PARAM 2 // value = parameter of the traffic model (sampling rate)
+#define CMD_TIME_WINDOW   3 // value in ms, for the whole network (applied by the border router)
+#define CMD_KEEPALIVE     4 // value in ms, interval of the availability check (CHECK_NETWORK)
+
+// Same beginning as data_structure_t, so the step_signal can be read the same way
+typedef struct command_structure{
+  uint8_t step_signal; // always 13
+  int node_rank;
+  uint8_t target;      // node_id of the destination, 0 for every node
+  uint8_t param;       // CMD_*
+  uint16_t value;
+}command_structure_t;
+
+/* Parameters received but not applied yet: a node applies all of them at once at its next schedule boundary */
+typedef struct command_config{
+  uint8_t mask; // bit (1 << CMD_*) set if the parameter is waiting
+  uint8_t traffic_model;
+  uint8_t traffic_param;
+  clock_time_t time_window;
+  clock_time_t keepalive;
+}command_config_t;
+
+#define COMMAND_PENDING(cfg, cmd) ((cfg)->mask & (1 << (cmd)))
+
+// Number of downward routes (node id -> child) a node remembers
+#ifdef ROUTE_CONF_TABLE_SIZE
+#define ROUTE_TABLE_SIZE ROUTE_CONF_TABLE_SIZE
+#else
+#define ROUTE_TABLE_SIZE 16
+#endif
+
+void command_stage(command_config_t *cfg, const command_structure_t *cmd);
+void command_output(const command_structure_t *cmd, const linkaddr_t *dest);
+void command_relay(const void *data, uint16_t len, int node_rank,
+                   const linkaddr_t *children, uint16_t nb_children, command_config_t *cfg);
+
+void route_learn(uint8_t node, const linkaddr_t *next_hop);
+const linkaddr_t *route_lookup(uint8_t node);
+void route_forget(const linkaddr_t *next_hop);
+#endif
@@ -2,13 +2,16 @@
 #include "net/netstack.h"
 #include "net/nullnet/nullnet.h"
 #include "net/packetbuf.h"
-#include "realloc.h"
+#include "command.h"
+#include "forward.h"
+#include "join.h"
 
 #include "sys/clock.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 
 #include "sys/node-id.h"
@@ -23,6 +26,13 @@
 #define SEND_INTERVAL (2 * CLOCK_SECOND)
 #define CHECK_NETWORK (5 * CLOCK_SECOND)
 #define TIME_WINDOW (2 * CLOCK_SECOND)
+#define TIMESLOT_TIMEOUT (20 * CLOCK_SECOND) // no timeslot for this time: removed by the border router (3 rounds of 5 s)
+
+#ifdef COORDINATOR_CONF_MAX_CHILDREN
+#define MAX_CHILDREN COORDINATOR_CONF_MAX_CHILDREN
+#else
+#define MAX_CHILDREN 8
+#endif
 
 //-------------------------------------
 
@@ -31,8 +41,8 @@ static int in_network = 0; // Says if the node is already connected to the netwo
 // ROUTING TABLE
 typedef struct node {
   linkaddr_t parent;  
-  linkaddr_t *children; 
-  int *child_reach_count; // number or round, the children didn't anwser (to know if they are still available)
+  linkaddr_t children[MAX_CHILDREN];
+  int child_reach_count[MAX_CHILDREN]; // number or round, the children didn't anwser (to know if they are still available)
   uint16_t nb_children;
 } node_t;
 
@@ -42,45 +52,50 @@ typedef struct data_structure{
   uint8_t data[2];
   clock_time_t clock;
   clock_time_t timeslot_array [2];
+  clock_time_t time_window; // length of the schedule, sent with the timeslot (SGN 9)
 }data_structure_t;
 
+PROJECT_STATIC_ASSERT(sizeof(data_structure_t) <= FRAME_MAX_PAYLOAD, data_frame_length);
+PROJECT_STATIC_ASSERT(sizeof(command_structure_t) <= FORWARD_BUF_SIZE, command_frame_forwardable);
+PROJECT_STATIC_ASSERT(sizeof(data_structure_t) <= FORWARD_BUF_SIZE, data_frame_forwardable);
+PROJECT_STATIC_ASSERT(offsetof(data_structure_t, node_rank) == offsetof(frame_header_t, node_rank), data_frame_header);
+
 static node_t my_node = { 
   .parent = {{0}}, // initialize all 8 bytes to 0
-  .children = NULL,
-  .child_reach_count = NULL,
   .nb_children = 0 
 };
 
 static data_structure_t data_to_send ={
   .node_rank = 1,
   .clock = 0,
-  .timeslot_array = {0, 0}
+  .timeslot_array = {0, 0},
+  .time_window = TIME_WINDOW
 };
 
 static struct ctimer timer;
 static struct ctimer check_network_timer;
 static struct ctimer get_sensor_data_timer;
-static int clock_compensation = 0;
+static struct ctimer timeslot_timer;
+static long int clock_compensation = 0; // synchronized clock - my clock (clock_time_t is 32 bits, int only 16 on the Z1)
+static uint8_t short_id = 0xFF; // index of the coordinator in the table of the border router (given with the timeslot)
+static clock_time_t check_network_interval = CHECK_NETWORK;
+static command_config_t pending_config; // parameters received from the server, applied at the end of the timeslot
 
-void add_child(node_t *n, linkaddr_t child) {
-  if(n->nb_children == 0){
-    n->children = (linkaddr_t *) malloc(sizeof(linkaddr_t));
-    n->child_reach_count = (int*) malloc(sizeof(int));
-  }
-  else{
-    // Allocate memory for one additional child
-    n->children = realloc(n->children, (n->nb_children + 1) * sizeof(linkaddr_t));   //-> is used to access the element of a struct through a pointer
-    n->child_reach_count = realloc(n->child_reach_count, (n->nb_children+1)*sizeof(int));
+/* Add a child to the table, return 0 if there is no room for it (MAX_CHILDREN) */
+int add_child(node_t *n, linkaddr_t child) {
+  if(n->nb_children >= MAX_CHILDREN){
+    return 0;
   }
-  // Copy the new child's address into the new memory location
-  linkaddr_copy(&n->children[n->nb_children], &child);
+  // Copy the new child's address into the first free entry
+  linkaddr_copy(&n->children[n->nb_children], &child);   //-> is used to access the element of a struct through a pointer
   n->child_reach_count[n->nb_children] = -1;
 
   // Increment the number of children
   n->nb_children++;
+  return 1;
 }
 
-void remove_child(node_t *n, linkaddr_t child) {  //Maybe free it if no children anymore?
+void remove_child(node_t *n, linkaddr_t child) {
   // Search for the index of the child in the array
   int i;
   for (i = 0; i < n->nb_children; i++) {
@@ -94,14 +109,46 @@ void remove_child(node_t *n, linkaddr_t child) {  //Maybe free it if no children
     if (i < n->nb_children -1) { //If it's not the last of the array
       // Shift all elements after the child's index down by one
       memmove(&n->children[i], &n->children[i + 1], (n->nb_children - i - 1) * sizeof(linkaddr_t));
-      memmove(&n->child_reach_count[i], &n->child_reach_count[i + 1], (n->nb_children - i - 1) * sizeof(uint8_t));
+      memmove(&n->child_reach_count[i], &n->child_reach_count[i + 1], (n->nb_children - i - 1) * sizeof(int));
     }
-    // Deallocate the memory for the last element in the array
-    n->children = realloc(n->children, (n->nb_children - 1) * sizeof(linkaddr_t));
-    n->child_reach_count = realloc(n->child_reach_count, (n->nb_children - 1) * sizeof(uint8_t));
     // Decrement the number of children
     n->nb_children--;
+    route_forget(&child); // the nodes behind this child can't be reached through it anymore
+  }
+}
+
+/* Return 1 if addr is in the list of children */
+static int is_child(const node_t *n, const linkaddr_t *addr){
+  for (int i = 0; i < n->nb_children; i++) {
+    if (linkaddr_cmp(&n->children[i], addr)) {
+      return 1;
+    }
   }
+  return 0;
+}
+
+/* SGN 3 sent to a node which believes I'm its parent, so it looks for a parent again */
+static void reject_child(const linkaddr_t *dest){
+  data_to_send.step_signal = 3;
+  NETSTACK_NETWORK.output(dest);
+}
+
+static void get_sensor_data(void* ptr);
+static void get_node_availability(void* ptr);
+static void timeslot_expired(void* ptr);
+void get_in_network(void* ptr);
+
+/* The parent doesn't have me as child (SGN 3 from the parent, or no timeslot anymore): join the network again */
+static void leave_network(){
+  LOG_INFO("Not a child of the border router anymore, joining again\n");
+  in_network = 0;
+  linkaddr_copy(&(my_node.parent), &linkaddr_null);
+  data_to_send.timeslot_array[0] = 0;  // the timeslot may now belong to another coordinator
+  data_to_send.timeslot_array[1] = 0;
+  short_id = 0xFF;
+  ctimer_stop(&timeslot_timer);
+  join_reset_backoff();
+  ctimer_set(&timer, join_first_delay(), get_in_network, NULL);
 }
 
 /* PROCESS CREATION */
@@ -125,32 +172,43 @@ void input_callback(const void *data, uint16_t len,
       LOG_DBG_("\n");
       data_to_send.step_signal = 2; // Send an ACK to the connection
       NETSTACK_NETWORK.output(&(my_node.parent));
+      ctimer_set(&timeslot_timer, TIMESLOT_TIMEOUT, timeslot_expired, NULL); // in case the ACK is lost
   }
   else if(in_network){
-    if(data_receive->step_signal == 0 && data_receive->node_rank != 1){ // CONNECTION REQUEST from sensors
+    if(data_receive->step_signal == 0 && data_receive->node_rank != 1 && my_node.nb_children < MAX_CHILDREN){ // CONNECTION REQUEST from sensors (only if there is room for a new child)
       LOG_DBG("SGN 0 (connexion request) received from ");
       LOG_DBG_LLADDR(&src_copy);
-      data_to_send.step_signal = 1; // Send a connection response
-      LOG_DBG_(" ; SGN 1 (connexion response) send to ");
-      LOG_DBG_LLADDR(&src_copy);
-      LOG_DBG_("\n");
-      NETSTACK_NETWORK.output(&src_copy);
+      LOG_DBG_(" ; SGN 1 (connexion response) scheduled\n");
+      join_schedule_response(&src_copy, data_to_send.node_rank); // Send a connection response after a short random delay
     }
     else if(data_receive->step_signal == 2){  // ACKNOWLEDGE CONNECTION
       LOG_DBG("SGN 2 (ACK) received from ");
       LOG_DBG_LLADDR(&src_copy);
       LOG_DBG_(" which is now my child\n");
-      add_child(&my_node, src_copy);  //add the child to the list of children
+      if(!is_child(&my_node, &src_copy) && !add_child(&my_node, src_copy)){  //add the child to the list of children
+        LOG_WARN("No room for a new child (MAX_CHILDREN = %u), SGN 3 sent\n", MAX_CHILDREN);
+        reject_child(&src_copy);  // several requesters may have accepted the last free place
+      }
     }
-    else if(data_receive->step_signal == 3){  // REMOVE CHILDREN
-      LOG_DBG("RECEIVED CHILD TO REMOVE from ");
-      LOG_DBG_LLADDR(src);
-      LOG_DBG_("\n");
-      remove_child(&my_node, src_copy);
+    else if(data_receive->step_signal == 3){
+      if(linkaddr_cmp(&src_copy, &(my_node.parent))){  // REJECTED BY THE PARENT
+        leave_network();
+      }
+      else{  // REMOVE CHILDREN
+        LOG_DBG("RECEIVED CHILD TO REMOVE from ");
+        LOG_DBG_LLADDR(src);
+        LOG_DBG_("\n");
+        remove_child(&my_node, src_copy);
+      }
     }
     else if(data_receive->step_signal == 4){
-      data_to_send.step_signal = 5;
-      NETSTACK_NETWORK.output(&src_copy);
+      if(is_child(&my_node, &src_copy)){
+        data_to_send.step_signal = 5;
+        NETSTACK_NETWORK.output(&src_copy);
+      }
+      else{ // it believes I'm its parent, but it's not in my list (no room when it joined, or removed)
+        reject_child(&src_copy);
+      }
     }
     else if(data_receive->step_signal == 5){
       for (int i = 0; i < my_node.nb_children; i++) {
@@ -165,6 +223,7 @@ void input_callback(const void *data, uint16_t len,
       LOG_DBG_LLADDR(&src_copy);
       
       data_to_send.clock = (clock_time_t)((long int) clock_time() + clock_compensation); // get its own clock
+      data_to_send.data[0] = short_id; // so the border router finds me in its table without searching
       data_to_send.step_signal = 7;
 
       LOG_DBG_(" ; My clock is %lu", data_to_send.clock);
@@ -172,43 +231,89 @@ void input_callback(const void *data, uint16_t len,
       NETSTACK_NETWORK.output(&src_copy);
 
     }
-    else if(data_receive->step_signal == 8){
-      LOG_DBG("RECEIVED NEW SYNCHRONIZED CLOCK");
-      clock_compensation = data_receive->clock - clock_time();
-      LOG_DBG_(" : %d", clock_compensation);
-      LOG_DBG_(" ; New clock: %lu\n", data_receive->clock);
-    }
-    else if(data_receive->step_signal == 9){
+    else if(data_receive->step_signal == 9){  // SYNCHRONIZED CLOCK AND TIMESLOT
+      clock_compensation = (long int) data_receive->clock - (long int) clock_time();
+      LOG_DBG("RECEIVED NEW SYNCHRONIZED CLOCK : %ld ; New clock: %lu\n", clock_compensation, data_receive->clock);
       LOG_DBG("RECEIVED TIMESLOT");
       data_to_send.timeslot_array[0] = data_receive->timeslot_array[0];
       data_to_send.timeslot_array[1] = data_receive->timeslot_array[1];
+      short_id = data_receive->data[0];
       LOG_DBG("Timseslots : 1) %lu ; 2) %lu : \n", data_to_send.timeslot_array[0],data_to_send.timeslot_array[1]);
+      if(data_receive->time_window != 0 && data_receive->time_window != data_to_send.time_window){
+        // The new timeslot starts a new schedule, so it's the moment to change the time window
+        data_to_send.time_window = data_receive->time_window;
+        LOG_INFO("New time window %lu\n", data_to_send.time_window);
+      }
+      ctimer_set(&timeslot_timer, TIMESLOT_TIMEOUT, timeslot_expired, NULL);
+      get_sensor_data(NULL); // set the timer on the new timeslot
     }
     else if(data_receive->step_signal == 12){
-      data_to_send.data[0] = data_receive->data[0];
-      data_to_send.data[1] = data_receive->data[1];
-      LOG_DBG("RECEIVE DATA FROM NODE %d : %d\n", data_to_send.data[0], data_to_send.data[1]);
-      data_to_send.step_signal = 12;
-      NETSTACK_NETWORK.output(&(my_node.parent));
+      route_learn(data_receive->data[0], &src_copy); // downward route to the origin of the data
+      LOG_DBG("RECEIVE DATA FROM NODE %d : %d\n", data_receive->data[0], data_receive->data[1]);
+      if(!forward_frame(data, len, data_to_send.node_rank, &(my_node.parent))){ // relay the frame as it is, data_to_send is not touched
+        LOG_WARN("Frame of %u bytes not forwarded (FORWARD_BUF_SIZE = %u)\n", len, FORWARD_BUF_SIZE);
+      }
+    }
+    else if(data_receive->step_signal == 13 && len >= sizeof(command_structure_t) && linkaddr_cmp(&src_copy, &(my_node.parent))){ // COMMAND FROM THE SERVER
+      command_relay(data, len, data_to_send.node_rank, my_node.children, my_node.nb_children, &pending_config);
     }
   }
 } 
 
+/* Apply at once all the parameters received from the server
+   (the time window comes from the border router with the timeslot)
+*/
+static void apply_pending_config(){
+  if(COMMAND_PENDING(&pending_config, CMD_KEEPALIVE) && pending_config.keepalive > 0){
+    check_network_interval = pending_config.keepalive;
+    ctimer_set(&check_network_timer, check_network_interval, get_node_availability, NULL);
+  }
+  pending_config.mask = 0;
+}
+
+/* Polling period of the children during the timeslot */
+static clock_time_t poll_interval(){
+  return data_to_send.time_window/10 > 0 ? data_to_send.time_window/10 : 1;
+}
+
+/* Poll the children during my timeslot. The timer is set on the beginning of the timeslot, then every
+   time_window/10 until its end (a fixed period would miss the short timeslots of a big network)
+*/
 static void get_sensor_data(void* ptr){
-  ctimer_reset(&get_sensor_data_timer);
-  if(data_to_send.timeslot_array[1] != 0){
-    //Check if the current "synchronised" clock is in the allocated time slot
-    if((clock_time() + clock_compensation)>data_to_send.timeslot_array[0] && (clock_time() + clock_compensation)<data_to_send.timeslot_array[1]){
-      for(int i=0; i < my_node.nb_children; i++){ //Notify the children to send data if they have any
-        data_to_send.step_signal = 11;
-        NETSTACK_NETWORK.output(&(my_node.children[i]));
-      }
+  clock_time_t now = clock_time() + clock_compensation;  // "synchronised" clock
+  clock_time_t next;
+
+  if(data_to_send.timeslot_array[1] == 0){
+    apply_pending_config(); // no schedule yet
+    ctimer_set(&get_sensor_data_timer, poll_interval(), get_sensor_data, NULL);
+    return;
+  }
+  while(now >= data_to_send.timeslot_array[1]){  //If the timeslot is already passed, addition it to the time windows
+    data_to_send.timeslot_array[0]+=data_to_send.time_window;
+    data_to_send.timeslot_array[1]+=data_to_send.time_window;
+    apply_pending_config(); // end of the timeslot = schedule boundary
+  }
+  if(now >= data_to_send.timeslot_array[0]){  //Check if the current "synchronised" clock is in the allocated time slot
+    for(int i=0; i < my_node.nb_children; i++){ //Notify the children to send data if they have any
+      data_to_send.step_signal = 11;
+      NETSTACK_NETWORK.output(&(my_node.children[i]));
     }
-    else if((clock_time() + clock_compensation)>data_to_send.timeslot_array[1]){  //If the timeslot is already passed, addition it to the time windows
-      data_to_send.timeslot_array[0]+=TIME_WINDOW;
-      data_to_send.timeslot_array[1]+=TIME_WINDOW;
+    next = now + poll_interval();
+    if(next > data_to_send.timeslot_array[1]){
+      next = data_to_send.timeslot_array[1]; // wake up at the end of the timeslot to move to the next one
     }
   }
+  else{
+    next = data_to_send.timeslot_array[0];
+  }
+  ctimer_set(&get_sensor_data_timer, next - now, get_sensor_data, NULL);
+}
+
+/* No timeslot received for TIMESLOT_TIMEOUT: the border router doesn't know me anymore */
+static void timeslot_expired(void* ptr){
+  if(in_network){
+    leave_network();
+  }
 }
 
 /* CALLBACK TO CHECK REACHABLE NODES */
@@ -229,14 +334,25 @@ static void get_node_availability(void* ptr){
   }
 }
 
+/* CONNECTION RESPONSE (SGN 1), called by the join module once the response delay is over */
+static void send_connection_response(const linkaddr_t *dest){
+  if(my_node.nb_children < MAX_CHILDREN){ // things may have changed during the delay
+    LOG_DBG("SGN 1 (connexion response) send to ");
+    LOG_DBG_LLADDR(dest);
+    LOG_DBG_("\n");
+    data_to_send.step_signal = 1;
+    NETSTACK_NETWORK.output(dest);
+  }
+}
+
 /* CONNECTION TO NETWORK */
 void get_in_network(void* ptr){
   if(!in_network){
-    ctimer_reset(&timer);
     // Not in the network at the moment -> broadcast a packet to know the neighboors
     LOG_DBG("Node %u broadcasts SGN 0\n", node_id);
     data_to_send.step_signal = 0;
     NETSTACK_NETWORK.output(NULL);
+    ctimer_set(&timer, join_next_backoff(), get_in_network, NULL); // wait longer after each request
   }
 }
 
@@ -252,9 +368,10 @@ PROCESS_THREAD(coordinator_process, ev, data)
   nullnet_len = sizeof(data_structure_t);
   nullnet_set_input_callback(input_callback);
 
-  ctimer_set(&timer, SEND_INTERVAL, get_in_network, NULL);
-  ctimer_set(&check_network_timer, CHECK_NETWORK, get_node_availability, NULL);
-  ctimer_set(&get_sensor_data_timer, TIME_WINDOW/10, get_sensor_data, NULL);
+  join_init(node_id, send_connection_response);
+  ctimer_set(&timer, join_first_delay(), get_in_network, NULL);
+  ctimer_set(&check_network_timer, check_network_interval, get_node_availability, NULL);
+  ctimer_set(&get_sensor_data_timer, poll_interval(), get_sensor_data, NULL);
 
   while (1) {
     PROCESS_WAIT_EVENT();
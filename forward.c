@@ -0,0 +1,53 @@
+// FORWARDING PATH: send frames without going through the application buffer (data_to_send) of the node
+#include "forward.h"
+#include "net/netstack.h"
+#include "net/nullnet/nullnet.h"
+
+#include <string.h>
+#include <stddef.h>
+
+static uint8_t forward_buf[FORWARD_BUF_SIZE];
+static uint16_t forward_len = 0;
+
+/* Send len bytes of frame to dest, then give back nullnet its application buffer */
+void frame_output(const void *frame, uint16_t len, const linkaddr_t *dest){
+  uint8_t *buf = nullnet_buf;
+  uint16_t buf_len = nullnet_len;
+  nullnet_buf = (uint8_t *) frame;
+  nullnet_len = len;
+  NETSTACK_NETWORK.output(dest);  // the frame is copied in packetbuf, the buffer can be restored
+  nullnet_buf = buf;
+  nullnet_len = buf_len;
+}
+
+/* Take a received frame as it is (whatever its length), only the rank of the sender is rewritten.
+   The frame still lives in packetbuf, which is overwritten by the first output, so it is kept in forward_buf
+   and can then be sent to several nodes with forward_send().
+   Return 0 if the frame is too big to be forwarded
+*/
+int forward_prepare(const void *frame, uint16_t len, int node_rank){
+  if(len < sizeof(frame_header_t) || len > FORWARD_BUF_SIZE){
+    forward_len = 0;
+    return 0;
+  }
+  memcpy(forward_buf, frame, len);
+  memcpy(forward_buf + offsetof(frame_header_t, node_rank), &node_rank, sizeof(int)); // forward_buf may not be aligned for an int
+  forward_len = len;
+  return 1;
+}
+
+/* Send the frame taken by forward_prepare() */
+void forward_send(const linkaddr_t *dest){
+  if(forward_len > 0){
+    frame_output(forward_buf, forward_len, dest);
+  }
+}
+
+/* Relay a received frame to a single node */
+int forward_frame(const void *frame, uint16_t len, int node_rank, const linkaddr_t *dest){
+  if(!forward_prepare(frame, len, node_rank)){
+    return 0;
+  }
+  forward_send(dest);
+  return 1;
+}
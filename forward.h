@@ -0,0 +1,31 @@
+#ifndef H_forward
+#define H_forward
+#include "contiki.h"
+#include "net/linkaddr.h"
+#include "net/packetbuf.h"
+
+// Every frame (data_structure_t, command_structure_t) starts with these fields
+typedef struct frame_header{
+  uint8_t step_signal;
+  int node_rank; // rank of the node which sends the frame (hop-specific)
+}frame_header_t;
+
+// Biggest payload of a radio frame, every frame of the project must fit in it
+#ifdef FRAME_CONF_MAX_PAYLOAD
+#define FRAME_MAX_PAYLOAD FRAME_CONF_MAX_PAYLOAD
+#else
+#define FRAME_MAX_PAYLOAD 100
+#endif
+
+// Biggest frame a relay can forward (by default any frame of the project)
+#ifdef FORWARD_CONF_BUF_SIZE
+#define FORWARD_BUF_SIZE FORWARD_CONF_BUF_SIZE
+#else
+#define FORWARD_BUF_SIZE FRAME_MAX_PAYLOAD
+#endif
+
+void frame_output(const void *frame, uint16_t len, const linkaddr_t *dest);
+int forward_prepare(const void *frame, uint16_t len, int node_rank);
+void forward_send(const linkaddr_t *dest);
+int forward_frame(const void *frame, uint16_t len, int node_rank, const linkaddr_t *dest);
+#endif
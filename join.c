@@ -0,0 +1,82 @@
+// JOIN: backoff of the connection requests (SGN 0) and rate-limited connection responses (SGN 1)
+#include "join.h"
+#include "lib/random.h"
+
+typedef struct response{
+  struct ctimer timer;
+  linkaddr_t dest;
+  uint8_t pending;      // 1 while the response waits for its timer
+  clock_time_t sent;    // time of the last response to dest (for the holdoff)
+}response_t;
+
+static response_t responses[JOIN_RESPONSE_QUEUE];
+static void (*respond_callback)(const linkaddr_t *dest) = NULL;
+static clock_time_t backoff = JOIN_BACKOFF_MIN;
+
+/* Random delay in [0, max[ */
+static clock_time_t jitter(clock_time_t max){
+  return max == 0 ? 0 : random_rand() % max;
+}
+
+void join_init(uint16_t seed, void (*respond)(const linkaddr_t *dest)){
+  random_init(seed); // different for every node, otherwise all the jitters are the same after a mass reboot
+  respond_callback = respond;
+  backoff = JOIN_BACKOFF_MIN;
+}
+
+/* Delay before the first request, so the nodes which boot together don't send it at the same time */
+clock_time_t join_first_delay(){
+  return jitter(JOIN_BACKOFF_MIN);
+}
+
+/* Delay before the next request, taken in [backoff/2, backoff[ (never more than JOIN_BACKOFF_MAX).
+   The backoff doubles at each request
+*/
+clock_time_t join_next_backoff(){
+  clock_time_t delay = backoff/2 + jitter(backoff - backoff/2);
+  backoff = backoff >= JOIN_BACKOFF_MAX / 2 ? JOIN_BACKOFF_MAX : backoff * 2;
+  return delay;
+}
+
+/* The node is in the network: the next time it looks for a parent, it starts again with a short backoff */
+void join_reset_backoff(){
+  backoff = JOIN_BACKOFF_MIN;
+}
+
+static void send_response(void *ptr){
+  response_t *r = (response_t *) ptr;
+  r->pending = 0;
+  r->sent = clock_time();
+  if(respond_callback != NULL){
+    respond_callback(&r->dest);
+  }
+}
+
+/* Answer to a connection request after rank * JOIN_RESPONSE_SLOT plus a jitter.
+   Return 0 if the request is ignored (answer already pending or just sent to dest, or queue full)
+*/
+int join_schedule_response(const linkaddr_t *dest, int rank){
+  response_t *free_entry = NULL;
+  clock_time_t now = clock_time();
+
+  for(int i = 0; i < JOIN_RESPONSE_QUEUE; i++){
+    response_t *r = &responses[i];
+    int recent = r->sent != 0 && now - r->sent < JOIN_RESPONSE_HOLDOFF;
+    if(linkaddr_cmp(&r->dest, dest) && (r->pending || recent)){
+      return 0;
+    }
+    if(!r->pending && !recent && free_entry == NULL){
+      free_entry = r;
+    }
+  }
+  if(free_entry == NULL){
+    return 0;
+  }
+
+  linkaddr_copy(&free_entry->dest, dest);
+  free_entry->pending = 1;
+  free_entry->sent = 0;
+  ctimer_set(&free_entry->timer, (rank < 0 ? 0 : rank) * JOIN_RESPONSE_SLOT + jitter(JOIN_RESPONSE_SLOT),
+             send_response, free_entry);
+  return 1;
+}
@@ -0,0 +1,53 @@
+#ifndef H_join
+#define H_join
+#include "contiki.h"
+#include "net/linkaddr.h"
+
+/* JOIN STORM MITIGATION
+   - the connection requests (SGN 0) are repeated with an exponential and jittered backoff
+     (the delay is taken in [backoff/2, backoff[, the backoff doubles from JOIN_BACKOFF_MIN to JOIN_BACKOFF_MAX)
+   - the connection responses (SGN 1) are delayed proportionally to the rank of the node, plus a jitter,
+     so the best parents answer first and the neighbors don't answer all at the same time
+*/
+
+// Delay before the first request, and first backoff
+#ifdef JOIN_CONF_BACKOFF_MIN
+#define JOIN_BACKOFF_MIN JOIN_CONF_BACKOFF_MIN
+#else
+#define JOIN_BACKOFF_MIN (CLOCK_SECOND / 2)
+#endif
+
+// Longest delay between two requests
+#ifdef JOIN_CONF_BACKOFF_MAX
+#define JOIN_BACKOFF_MAX JOIN_CONF_BACKOFF_MAX
+#else
+#define JOIN_BACKOFF_MAX (8 * CLOCK_SECOND)
+#endif
+
+// Delay of a response per rank of the responder (the jitter is taken in [0, JOIN_RESPONSE_SLOT[)
+#ifdef JOIN_CONF_RESPONSE_SLOT
+#define JOIN_RESPONSE_SLOT JOIN_CONF_RESPONSE_SLOT
+#else
+#define JOIN_RESPONSE_SLOT (CLOCK_SECOND / 8)
+#endif
+
+// A node answers at most once to the same requester during this time
+#ifdef JOIN_CONF_RESPONSE_HOLDOFF
+#define JOIN_RESPONSE_HOLDOFF JOIN_CONF_RESPONSE_HOLDOFF
+#else
+#define JOIN_RESPONSE_HOLDOFF CLOCK_SECOND
+#endif
+
+// Responses waiting to be sent (more requests at the same time are ignored)
+#ifdef JOIN_CONF_RESPONSE_QUEUE
+#define JOIN_RESPONSE_QUEUE JOIN_CONF_RESPONSE_QUEUE
+#else
+#define JOIN_RESPONSE_QUEUE 4
+#endif
+
+void join_init(uint16_t seed, void (*respond)(const linkaddr_t *dest));
+clock_time_t join_first_delay(void);
+clock_time_t join_next_backoff(void);
+void join_reset_backoff(void);
+int join_schedule_response(const linkaddr_t *dest, int rank);
+#endif
@@ -0,0 +1,27 @@
+#ifndef PROJECT_CONF_H_
+#define PROJECT_CONF_H_
+
+/* RAM / ROM BUDGET
+   Every capacity of the project is fixed here, nothing is allocated at run time.
+   A Z1 has 8 KB of RAM and 92 KB of flash: run "make size-report" to see what each image uses.
+*/
+
+/* CHILDREN OF A NODE */
+#define BORDER_ROUTER_CONF_MAX_CHILDREN 32 // coordinators (table indexed by their short ID), a round must fit in BERKELEY_INTERVAL
+#define COORDINATOR_CONF_MAX_CHILDREN 8
+#define SENSOR_CONF_MAX_CHILDREN 4
+
+/* QUEUES AND TABLES */
+#define ROUTE_CONF_TABLE_SIZE 16     // downward routes learned from the uplink (command.h)
+#define FORWARD_CONF_BUF_SIZE FRAME_CONF_MAX_PAYLOAD // biggest frame a relay can forward (forward.h): any frame
+#define TRAFFIC_CONF_MAX_PER_POLL 4  // readings sent by a sensor on one poll (traffic.h)
+#define JOIN_CONF_RESPONSE_QUEUE 4   // connection responses waiting for their delay (join.h)
+
+/* FRAMES */
+// Payload of a 127 bytes 802.15.4 frame, minus the biggest MAC header and the CRC
+#define FRAME_CONF_MAX_PAYLOAD 100
+
+/* Compile time check: the build fails (negative array size) if cond is false */
+#define PROJECT_STATIC_ASSERT(cond, name) typedef char project_static_assert_##name[(cond) ? 1 : -1]
+
+#endif /* PROJECT_CONF_H_ */
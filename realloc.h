@@ -1,7 +0,0 @@
-#ifndef H_realloc
-#define H_realloc
-#include <stdlib.h>
-
-size_t getsize(void *p);
-void *realloc(void *ptr, size_t size);
-#endif
@@ -2,11 +2,15 @@
 #include "net/netstack.h"
 #include "net/nullnet/nullnet.h"
 #include "net/packetbuf.h"
-#include "realloc.h"
+#include "traffic.h"
+#include "command.h"
+#include "forward.h"
+#include "join.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 
 #include "sys/node-id.h"
@@ -22,6 +26,12 @@
 #define SEND_INTERVAL (2 * CLOCK_SECOND)
 #define CHECK_NETWORK (5 * CLOCK_SECOND)
 
+#ifdef SENSOR_CONF_MAX_CHILDREN
+#define MAX_CHILDREN SENSOR_CONF_MAX_CHILDREN
+#else
+#define MAX_CHILDREN 4
+#endif
+
 //-------------------------------------
 
 static int in_network = 0; // Says if the node is already connected to the network
@@ -30,8 +40,8 @@ static int in_network = 0; // Says if the node is already connected to the netwo
 typedef struct node {
   linkaddr_t parent;
   int parent_reach_count; // number or round, the parent didn't anwser (to know if it still reachable)
-  linkaddr_t *children;
-  int *child_reach_count; // same as the parent_reach_count but for children
+  linkaddr_t children[MAX_CHILDREN];
+  int child_reach_count[MAX_CHILDREN]; // same as the parent_reach_count but for children
   uint16_t nb_children;
 } node_t;
 
@@ -41,11 +51,14 @@ typedef struct data_structure{
   uint8_t data [2]; //ID, DATA
 }data_structure_t;
 
+PROJECT_STATIC_ASSERT(sizeof(data_structure_t) <= FRAME_MAX_PAYLOAD, data_frame_length);
+PROJECT_STATIC_ASSERT(sizeof(command_structure_t) <= FORWARD_BUF_SIZE, command_frame_forwardable);
+PROJECT_STATIC_ASSERT(sizeof(data_structure_t) <= FORWARD_BUF_SIZE, data_frame_forwardable);
+PROJECT_STATIC_ASSERT(offsetof(data_structure_t, node_rank) == offsetof(frame_header_t, node_rank), data_frame_header);
+
 static node_t my_node = { 
   .parent = {{0}}, // initialize all 8 bytes to 0
   .parent_reach_count = 0,
-  .children = NULL,
-  .child_reach_count = NULL,
   .nb_children = 0 
 };
 
@@ -56,21 +69,19 @@ static data_structure_t data_to_send ={
 static struct ctimer timer;
 static struct ctimer check_network_timer;
 static int best_rssi = -100;
+static clock_time_t check_network_interval = CHECK_NETWORK;
+static command_config_t pending_config; // parameters received from the server, applied on the next poll
 
-void add_child(node_t *n, linkaddr_t child) {
-  if(n->nb_children == 0){
-    n->children = (linkaddr_t *) malloc(sizeof(linkaddr_t));
-    n->child_reach_count = (int*) malloc(sizeof(int));
-  }
-  else{
-    // Allocate memory for one additional child
-    n->children = realloc(n->children, (n->nb_children + 1) * sizeof(linkaddr_t));
-    n->child_reach_count = realloc(n->child_reach_count, (n->nb_children+1)*sizeof(int));
+/* Add a child to the table, return 0 if there is no room for it (MAX_CHILDREN) */
+int add_child(node_t *n, linkaddr_t child) {
+  if(n->nb_children >= MAX_CHILDREN){
+    return 0;
   }
-  // Copy the new child's address into the new memory location
+  // Copy the new child's address into the first free entry
   linkaddr_copy(&n->children[n->nb_children], &child);
   n->child_reach_count[n->nb_children] = 0;
   n->nb_children++;
+  return 1;
 }
 
 void remove_child(node_t *n, linkaddr_t child) {
@@ -87,12 +98,10 @@ void remove_child(node_t *n, linkaddr_t child) {
     if (i < n->nb_children -1) { //If it's not the last of the array
       // Shift all elements after the child's index down by one
       memmove(&n->children[i], &n->children[i + 1], (n->nb_children - i - 1) * sizeof(linkaddr_t));
-      memmove(&n->child_reach_count[i], &n->child_reach_count[i + 1], (n->nb_children - i - 1) * sizeof(uint8_t));
+      memmove(&n->child_reach_count[i], &n->child_reach_count[i + 1], (n->nb_children - i - 1) * sizeof(int));
     }
-    // Deallocate the memory for the last element in the array
-    n->children = realloc(n->children, (n->nb_children - 1) * sizeof(linkaddr_t));
-    n->child_reach_count = realloc(n->child_reach_count, (n->nb_children - 1) * sizeof(uint8_t));
     n->nb_children--;
+    route_forget(&child); // the nodes behind this child can't be reached through it anymore
   }
 }
 
@@ -111,6 +120,33 @@ int is_better_rssi(){
   }
 }
 
+/* Return 1 if addr is in the list of children */
+static int is_child(const node_t *n, const linkaddr_t *addr){
+  for (int i = 0; i < n->nb_children; i++) {
+    if (linkaddr_cmp(&n->children[i], addr)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* SGN 3 sent to a node which believes I'm its parent, so it looks for a parent again */
+static void reject_child(const linkaddr_t *dest){
+  data_to_send.step_signal = 3;
+  NETSTACK_NETWORK.output(dest);
+}
+
+/* Forget the parent (not reachable, or it doesn't have me as child anymore) */
+static void leave_parent(){
+  linkaddr_copy(&my_node.parent, &linkaddr_null); //setting parent to the null address
+  my_node.parent_reach_count = 0;
+  in_network = 0;
+  best_rssi=-100;
+}
+
+static void apply_pending_config();
+void get_in_network(void* ptr);
+
 /* PROCESS CREATION */
 PROCESS(sensor_process, "Sensor node");
 AUTOSTART_PROCESSES(&sensor_process);
@@ -143,13 +179,15 @@ void input_callback(const void *data, uint16_t len,
   }
   else if(in_network){
     if(data_receive->step_signal == 0){ // CONNECTION REQUEST
-      LOG_DBG("SGN 0 (connexion request) received from ");
-      LOG_DBG_LLADDR(&src_copy);
-      data_to_send.step_signal = 1; // Send a connection response
-      LOG_DBG_(" ; SGN 1 (connexion response) send to ");
-      LOG_DBG_LLADDR(&src_copy);
-      LOG_DBG_("\n");
-      NETSTACK_NETWORK.output(&src_copy);
+      // Only answer if there is room for a new child and if the requester would accept me as parent
+      // (new node, or a node which needs a sensor parent with a lower rank than its own)
+      if(my_node.nb_children < MAX_CHILDREN &&
+         (data_receive->node_rank == -1 || (data_receive->node_rank > 2 && data_to_send.node_rank < data_receive->node_rank))){
+        LOG_DBG("SGN 0 (connexion request) received from ");
+        LOG_DBG_LLADDR(&src_copy);
+        LOG_DBG_(" ; SGN 1 (connexion response) scheduled\n");
+        join_schedule_response(&src_copy, data_to_send.node_rank); // Send a connection response later, the lower ranks answer first
+      }
     }
     else if(data_receive->step_signal == 1 && !linkaddr_cmp(&(my_node.parent), &linkaddr_null)){  //Also check if there is a parent
       if(data_receive->node_rank == 1 || (data_receive->node_rank > 1 && data_to_send.node_rank > 2 && data_receive->node_rank < data_to_send.node_rank)){
@@ -188,17 +226,33 @@ void input_callback(const void *data, uint16_t len,
       LOG_DBG("SGN 2 (ACK) received from ");
       LOG_DBG_LLADDR(&src_copy);
       LOG_DBG_(" which is now my child\n");
-      add_child(&my_node, src_copy);  //add the child to the list of children
+      if(!is_child(&my_node, &src_copy) && !add_child(&my_node, src_copy)){  //add the child to the list of children
+        LOG_WARN("No room for a new child (MAX_CHILDREN = %u), SGN 3 sent\n", MAX_CHILDREN);
+        reject_child(&src_copy);  // several requesters may have accepted the last free place
+      }
     }
-    else if(data_receive->step_signal == 3){  // REMOVE CHILDREN
-      LOG_DBG("RECEIVED CHILD TO REMOVE from ");
-      LOG_DBG_LLADDR(&src_copy);
-      LOG_DBG_("\n");
-      remove_child(&my_node, src_copy);
+    else if(data_receive->step_signal == 3){
+      if(linkaddr_cmp(&src_copy, &(my_node.parent))){  // REJECTED BY THE PARENT
+        LOG_INFO("Not a child of my parent anymore, joining again\n");
+        leave_parent();
+        join_reset_backoff();
+        ctimer_set(&timer, join_first_delay(), get_in_network, NULL);
+      }
+      else{  // REMOVE CHILDREN
+        LOG_DBG("RECEIVED CHILD TO REMOVE from ");
+        LOG_DBG_LLADDR(&src_copy);
+        LOG_DBG_("\n");
+        remove_child(&my_node, src_copy);
+      }
     }
     else if(data_receive->step_signal == 4){  // NODE AVAILABILITY CHECK
-      data_to_send.step_signal = 5;
-      NETSTACK_NETWORK.output(&src_copy);
+      if(is_child(&my_node, &src_copy) || linkaddr_cmp(&src_copy, &(my_node.parent))){
+        data_to_send.step_signal = 5;
+        NETSTACK_NETWORK.output(&src_copy);
+      }
+      else{ // it believes I'm its parent, but it's not in my list (no room when it joined, or removed)
+        reject_child(&src_copy);
+      }
     }
     else if(data_receive->step_signal == 5){  // NODE AVAILABILITY RECEIVE
       if (linkaddr_cmp(&my_node.parent, &src_copy)) {
@@ -221,23 +275,27 @@ void input_callback(const void *data, uint16_t len,
       }
     }
     else if(data_receive->step_signal == 11){
+      apply_pending_config(); // the poll is the schedule boundary of the sensor
       for(int i=0; i < my_node.nb_children; i++){
         data_to_send.step_signal = 11;
         NETSTACK_NETWORK.output(&(my_node.children[i]));
       }
-      srand(clock_time());
-      if(abs(rand()%6)==1){ //chose a random number between 1 and 5 to get a probability of 20% to send a data
+      uint8_t nb_readings = traffic_poll(); //the traffic model decides how many data to send on this poll
+      for(uint8_t i=0; i < nb_readings; i++){
         data_to_send.data[0] = node_id;
-        data_to_send.data[1] = abs(rand()%101); // between 1 and 100
+        data_to_send.data[1] = traffic_value(); // between 0 and 100
         data_to_send.step_signal = 12;
         NETSTACK_NETWORK.output(&src_copy);
       }
     }
     else if(data_receive->step_signal == 12){ //Send data from here to root by sending any step_signal = 12 to the parent
-      data_to_send.data[0] = data_receive->data[0];
-      data_to_send.data[1] = data_receive->data[1];
-      data_to_send.step_signal = 12;
-      NETSTACK_NETWORK.output(&(my_node.parent));
+      route_learn(data_receive->data[0], &src_copy); // downward route to the origin of the data
+      if(!forward_frame(data, len, data_to_send.node_rank, &(my_node.parent))){ // relay the frame as it is, data_to_send is not touched
+        LOG_WARN("Frame of %u bytes not forwarded (FORWARD_BUF_SIZE = %u)\n", len, FORWARD_BUF_SIZE);
+      }
+    }
+    else if(data_receive->step_signal == 13 && len >= sizeof(command_structure_t) && linkaddr_cmp(&src_copy, &(my_node.parent))){ // COMMAND FROM THE SERVER
+      command_relay(data, len, data_to_send.node_rank, my_node.children, my_node.nb_children, &pending_config);
     }
   }
 } 
@@ -250,10 +308,8 @@ static void get_node_availability(void* ptr){
       LOG_DBG_("Parent not reachable anymore : ");
       LOG_DBG_LLADDR(&my_node.parent);
       LOG_DBG_("; temporary removal\n");
-      linkaddr_copy(&my_node.parent, &linkaddr_null); //setting parent to the null address
+      leave_parent();
       my_node.parent_reach_count = -1;  //So it goes to 0 after the next increment
-      in_network = 0;
-      best_rssi=-100;
     }
     else{
       data_to_send.step_signal = 4; //Aware that it's still reachable
@@ -276,14 +332,51 @@ static void get_node_availability(void* ptr){
   }
 }
 
+/* Apply at once all the parameters received from the server */
+static void apply_pending_config(){
+  if(COMMAND_PENDING(&pending_config, CMD_TRAFFIC_MODEL) || COMMAND_PENDING(&pending_config, CMD_TRAFFIC_PARAM)){
+    uint8_t model = traffic_get_model();
+    uint8_t param = traffic_get_param();
+    if(COMMAND_PENDING(&pending_config, CMD_TRAFFIC_MODEL) && pending_config.traffic_model != model){
+      model = pending_config.traffic_model;
+      param = 0; // the parameter of the old model means nothing for the new one
+    }
+    if(COMMAND_PENDING(&pending_config, CMD_TRAFFIC_PARAM)){
+      param = pending_config.traffic_param;
+    }
+    traffic_set_model(model, param);
+    LOG_INFO("New traffic model %u (param %u)\n", traffic_get_model(), traffic_get_param());
+  }
+  if(COMMAND_PENDING(&pending_config, CMD_KEEPALIVE) && pending_config.keepalive > 0){
+    check_network_interval = pending_config.keepalive;
+    ctimer_set(&check_network_timer, check_network_interval, get_node_availability, NULL);
+  }
+  pending_config.mask = 0;
+}
+
+/* CONNECTION RESPONSE (SGN 1), called by the join module once the response delay is over */
+static void send_connection_response(const linkaddr_t *dest){
+  if(in_network && my_node.nb_children < MAX_CHILDREN){ // things may have changed during the delay
+    LOG_DBG("SGN 1 (connexion response) send to ");
+    LOG_DBG_LLADDR(dest);
+    LOG_DBG_("\n");
+    data_to_send.step_signal = 1;
+    NETSTACK_NETWORK.output(dest);
+  }
+}
+
 /* CONNECTION TO NETWORK */
 void get_in_network(void* ptr){
-  ctimer_reset(&timer);
   if(!in_network){
     // Not in the network at the moment -> broadcast a packet to know the neighboors
     LOG_DBG("Node %u broadcasts SGN 0\n", node_id); //node_id return the ID of the current node
     data_to_send.step_signal = 0;
     NETSTACK_NETWORK.output(NULL);
+    ctimer_set(&timer, join_next_backoff(), get_in_network, NULL); // wait longer after each request
+  }
+  else{
+    join_reset_backoff();
+    ctimer_set(&timer, SEND_INTERVAL, get_in_network, NULL); // check again later, in case the parent is lost
   }
 }
 
@@ -298,8 +391,12 @@ PROCESS_THREAD(sensor_process, ev, data)
   nullnet_len = sizeof(data_structure_t);
   nullnet_set_input_callback(input_callback);
 
-  ctimer_set(&timer, SEND_INTERVAL, get_in_network, NULL);
-  ctimer_set(&check_network_timer, CHECK_NETWORK, get_node_availability, NULL);
+  traffic_init(node_id);
+  LOG_INFO("Traffic model %u (param %u)\n", traffic_get_model(), traffic_get_param());
+
+  join_init(node_id, send_connection_response);
+  ctimer_set(&timer, join_first_delay(), get_in_network, NULL);
+  ctimer_set(&check_network_timer, check_network_interval, get_node_availability, NULL);
   while (1) {
     PROCESS_WAIT_EVENT();
   }
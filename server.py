@@ -2,52 +2,95 @@ import socket
 import argparse
 import time
 import json
+from datetime import datetime
+
+from aggregator import Aggregator
+
+# Parameters of the downlink commands (see command.h)
+COMMAND_PARAMS = {"model": 1, "rate": 2, "window": 3, "keepalive": 4}
+# Traffic models of the sensors (see traffic.h)
+TRAFFIC_MODELS = {"constant": 0, "poisson": 1, "bursty": 2, "trace": 3}
 
 # Global dictionary
 # Each key is a node and the value is its counter of people
 global_counter_save = {}
 
-def receive(sock):
+def receive(sock, buf):
     """
-    Receptions the data arriving at the sock Socket
+    Receptions the data arriving at the sock Socket, by blocks
 
     Parameters
     ----------
     sock -- socket on which we receive the data (Socket)
+    buf -- data already received but not ended by a new line (binary str)
 
     Returns
     -------
-    buf -- binary string with all the content received (binary str)
+    lines -- complete lines received (list of binary str)
+    buf -- rest of the data, not ended by a new line yet (binary str)
     """
+    data = sock.recv(4096)
+    if not data:
+        raise socket.error("Connection closed by the border router")
 
-    data = sock.recv(1)
-    buf = b""
+    *lines, buf = (buf + data).split(b"\n")
+    return lines, buf
 
-    # While there is data, keep receiving
-    while data.decode("utf-8") != "\n":
-        buf += data
-        data = sock.recv(1)
-    
-    return buf
+def send_command(sock, target, param, value):
+    """
+    Send a command to the border router, which routes it down to the target node
+
+    Parameters
+    ----------
+    sock -- socket connected to the serial socket of the border router (Socket)
+    target -- id of the destination node, 0 for every node (int)
+    param -- name of the parameter, key of COMMAND_PARAMS (str)
+    value -- new value: traffic model name or number for "model",
+             traffic parameter for "rate", milliseconds for "window" and "keepalive" (str or int)
+    """
+    if param not in COMMAND_PARAMS:
+        raise ValueError(f"Unknown parameter {param}")
+    if param == "model" and str(value) in TRAFFIC_MODELS:
+        value = TRAFFIC_MODELS[str(value)]
+
+    sock.sendall(f"magic2023-cmd,{int(target)},{COMMAND_PARAMS[param]},{int(value)}\n".encode("utf-8"))
+
+def parse_command(command):
+    """
+    Parse a command given on the command line
+
+    Parameter
+    ---------
+    command -- string "target,param,value" (str)
 
-def data_treatment(data):
+    Returns
+    -------
+    (target, param, value) -- tuple given to send_command
+    """
+    target, param, value = command.split(",")
+    return int(target), param, value
+
+def data_treatment(data, aggregator, timestamp):
     """
     Function to treat the data accordingly to the format chosen
 
     Parameters
     ----------
     data: string with the data received
+    aggregator: windowed statistics updated with the reading (Aggregator)
+    timestamp: reception time of the data in seconds (float)
     """
     # Make sure it is pertinent data
-    if not ',' in data or data[:9] != "magic2023":
+    if not ',' in data or data[:9] != "magic2023" or data.startswith("magic2023-cmd"):
         return
 
     data = data.split("-")[1]
-    # It should split the data in 2 parts (id, counter)
-    data_split = data.split(",")
+    # It should split the data in 2 or 3 parts (id, counter, link address of the coordinator)
+    data_split = data.strip().split(",")
     
     node_id = data_split[0]
     node_counter = data_split[1]
+    coordinator = data_split[2] if len(data_split) > 2 else None
 
     # Update value of node counter in the global save
     # Create value for dictionary if not already in keys
@@ -57,8 +100,23 @@ def data_treatment(data):
     else:
         global_counter_save[f"Node_{node_id}"] += int(node_counter)
 
-    # Display node id
-    display_node_counter(node_id)
+    # The statistics are displayed at the end of each window, not for every reading
+    aggregator.add(timestamp, node_id, int(node_counter), coordinator)
+
+def display_summaries(aggregator, start, kinds):
+    """
+    Display the statistics of the window beginning at start
+
+    Parameters
+    ----------
+    aggregator -- windowed statistics (Aggregator)
+    start -- beginning of the tumbling window (int)
+    kinds -- kinds of series to display ("network", "coordinator", "node") (tuple)
+    """
+    lines = [f"---- {datetime.fromtimestamp(start).strftime('%H:%M:%S')} ----"]
+    for key, tumbling, sliding in aggregator.summaries(start, kinds):
+        lines.append(aggregator.format_summary(key, tumbling, sliding))
+    print("\n".join(lines), flush=True)
 
 def display_global_counter_message():
     """
@@ -93,7 +151,7 @@ def save_data(data_dict, file_name):
     with open(file_name, 'w') as save_file:
         json.dump(data_dict, save_file)
 
-def main(ip, port, saveFile=False):
+def main(ip, port, saveFile=False, commands=(), window=60, sliding=300, report_nodes=False):
     """
     Main loop; communication establishment
     + exchange/receive messages with ip:port
@@ -103,8 +161,15 @@ def main(ip, port, saveFile=False):
     ip -- ip address of the device we try to reach
     port -- port of the device we try to reach
     saveFile -- true if there is a file with an existing save of node counters
+    commands -- commands (target, param, value) sent to the network once connected
+    window -- length in seconds of the windows of the statistics, displayed at the end of each one
+    sliding -- length in seconds of the sliding window of the statistics
+    report_nodes -- also display the statistics of every node (not only coordinators and network)
     """
+    global global_counter_save
     save_name = "global_counter_save.json"
+    aggregator = Aggregator(window, sliding)
+    kinds = ("network", "coordinator", "node") if report_nodes else ("network", "coordinator")
 
     # Restore save from existing file
     if saveFile:
@@ -116,19 +181,32 @@ def main(ip, port, saveFile=False):
     sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
     sock.connect((ip, port))
 
+    for command in commands:
+        send_command(sock, *command)
+
+    # Wake up regularly even if nothing arrives, to display the statistics in time
+    sock.settimeout(1)
+    buf = b""
+    next_report = aggregator.window_start(time.time()) + window
+
     # As long as connection is running, keep the server up
     while True:
         try:
-            data = receive(sock)
-            #print(data.decode("utf-8"))
-
-            data_treatment(data.decode("utf-8"))
-                
-            time.sleep(0.1)
+            lines, buf = receive(sock, buf)
+            now = time.time()
+            for data in lines:
+                #print(data.decode("utf-8"))
+                data_treatment(data.decode("utf-8", errors="replace"), aggregator, now)
+        except socket.timeout:
+            pass
         except socket.error:
             print("Connection closed.")
             break
 
+        while time.time() >= next_report:
+            display_summaries(aggregator, next_report - window, kinds)
+            next_report += window
+
     # Save dictionnary into a file when connection fails
     if saveFile:
         save_data(global_counter_save, save_name)
@@ -139,7 +217,15 @@ if __name__ == "__main__":
     parser.add_argument("--ip", dest="ip", type=str)
     parser.add_argument("--port", dest="port", type=int)
     parser.add_argument("--save", dest="save", type=bool, default=False)
+    parser.add_argument("--cmd", dest="commands", type=parse_command, action="append", default=[],
+                        help="target,param,value with param in " + "/".join(COMMAND_PARAMS))
+    parser.add_argument("--window", dest="window", type=int, default=60,
+                        help="statistics window in seconds")
+    parser.add_argument("--sliding", dest="sliding", type=int, default=300,
+                        help="sliding statistics window in seconds (multiple of --window)")
+    parser.add_argument("--report-nodes", dest="report_nodes", action="store_true",
+                        help="also display the statistics of every node")
     args = parser.parse_args()
 
     #main(args.ip, args.port)
-    main(args.ip, args.port, args.save)
+    main(args.ip, args.port, args.save, args.commands, args.window, args.sliding, args.report_nodes)
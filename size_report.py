@@ -0,0 +1,113 @@
+import argparse
+import os
+import subprocess
+from collections import Counter
+
+# Memory of the Z1 mote (MSP430F2617)
+RAM_LIMIT = 8 * 1024
+ROM_LIMIT = 92 * 1024
+
+def symbol_sizes(nm, path):
+    """
+    List the symbols defined in an object file or an image.
+    They are keyed by address: two static symbols with the same name (in different objects) stay distinct
+
+    Parameters
+    ----------
+    nm -- nm tool of the toolchain (str)
+    path -- object file or image (str)
+
+    Returns
+    -------
+    symbols -- dict {address: (name, kind, size, source)} with kind "text", "rodata", "data" or "bss",
+               source the source file of the symbol (without extension), None without debug information (dict)
+    """
+    output = subprocess.run([nm, "-S", "-l", "--defined-only", path],
+                            check=True, capture_output=True, text=True).stdout
+    kinds = {"t": "text", "r": "rodata", "d": "data", "g": "data", "b": "bss", "s": "bss", "c": "bss"}
+    symbols = {}
+    for line in output.splitlines():
+        # Only the symbols with a size: "address size type name[\tfile:line]"
+        fields, _, location = line.partition("\t")
+        fields = fields.split()
+        if len(fields) != 4 or fields[2].lower() not in kinds:
+            continue
+        source = os.path.splitext(os.path.basename(location.rsplit(":", 1)[0]))[0] if location else None
+        symbols[int(fields[0], 16)] = (fields[3], kinds[fields[2].lower()], int(fields[1], 16), source)
+    return symbols
+
+def image_totals(size, image):
+    """
+    Total RAM and ROM used by an image, read with the size tool (berkeley format)
+
+    Returns
+    -------
+    (ram, rom) -- bytes used (tuple)
+    """
+    output = subprocess.run([size, image], check=True, capture_output=True, text=True).stdout
+    text, data, bss = (int(value) for value in output.splitlines()[1].split()[:3])
+    return data + bss, text + data
+
+def module_usage(symbols):
+    """
+    Returns (ram, rom) used by a set of symbols
+    """
+    ram = sum(s for _, kind, s, _ in symbols.values() if kind in ("data", "bss"))
+    rom = sum(s for _, kind, s, _ in symbols.values() if kind in ("text", "rodata", "data"))
+    return ram, rom
+
+def report(nm, size, image, objects):
+    """
+    Print the RAM/ROM usage of an image, module by module.
+    The symbols of the image which are not in the objects of the project belong to Contiki (OS, network stack, libc)
+
+    Parameters
+    ----------
+    nm -- nm tool of the toolchain (str)
+    size -- size tool of the toolchain (str)
+    image -- linked image (str)
+    objects -- object files of the project linked in the image (list of str)
+    """
+    image_symbols = symbol_sizes(nm, image)
+    remaining = dict(image_symbols)
+    name_count = Counter((name, kind) for name, kind, _, _ in image_symbols.values())
+
+    print(f"{os.path.basename(image)}")
+    print(f"  {'module':<24}{'RAM':>8}{'ROM':>8}")
+    for obj in objects:
+        module = os.path.splitext(os.path.basename(obj))[0]
+        names = {(name, kind) for name, kind, _, _ in symbol_sizes(nm, obj).values()}
+        # Only keep what the linker really put in the image. A symbol belongs to the module if the debug
+        # information says so, or without it, if its name is defined only once in the image
+        symbols = {}
+        for address, symbol in remaining.items():
+            name, kind, _, source = symbol
+            if source is not None:
+                if source == module:
+                    symbols[address] = symbol
+            elif (name, kind) in names and name_count[(name, kind)] == 1:
+                symbols[address] = symbol
+        for address in symbols:
+            del remaining[address]
+        ram, rom = module_usage(symbols)
+        print(f"  {module:<24}{ram:>8}{rom:>8}")
+
+    ram, rom = module_usage(remaining)
+    print(f"  {'contiki':<24}{ram:>8}{rom:>8}")
+
+    ram, rom = image_totals(size, image)
+    print(f"  {'total':<24}{ram:>8}{rom:>8}")
+    print(f"  {'limit':<24}{RAM_LIMIT:>8}{ROM_LIMIT:>8}")
+    print(f"  {'used':<24}{100 * ram / RAM_LIMIT:>7.1f}%{100 * rom / ROM_LIMIT:>7.1f}%")
+    print()
+
+if __name__ == "__main__":
+
+    parser = argparse.ArgumentParser(description="RAM/ROM usage of a Contiki image, per module")
+    parser.add_argument("--nm", dest="nm", type=str, default="msp430-nm")
+    parser.add_argument("--size", dest="size", type=str, default="msp430-size")
+    parser.add_argument("image", type=str)
+    parser.add_argument("objects", type=str, nargs="+")
+    args = parser.parse_args()
+
+    report(args.nm, args.size, args.image, args.objects)
@@ -0,0 +1,127 @@
+// TRAFFIC GENERATOR: decides how many readings a sensor sends each time it is polled (SGN 11)
+#include "traffic.h"
+
+static uint32_t prng_state = 1; // xorshift32 state, private to this node
+static uint16_t node_seed_id = 0;
+
+static uint8_t model = TRAFFIC_MODEL;
+static uint8_t param = TRAFFIC_PARAM;
+
+static uint8_t constant_count = 0;  // polls since the last reading (constant model)
+static uint32_t poisson_exp_neg = 0; // e^(-lambda) in Q16 (poisson model)
+static uint8_t burst_on = 0;        // 1 if the source is currently sending (bursty model)
+static const uint8_t trace[] = TRAFFIC_TRACE;
+static uint16_t trace_index = 0;
+
+static uint32_t prng_next(){
+  prng_state ^= prng_state << 13;
+  prng_state ^= prng_state >> 17;
+  prng_state ^= prng_state << 5;
+  return prng_state;
+}
+
+static uint16_t prng_next16(){
+  return (uint16_t)(prng_next() >> 16); // upper bits are the better ones
+}
+
+static uint8_t default_param(uint8_t m){
+  switch(m){
+    case TRAFFIC_MODEL_CONSTANT: return 5;  // 20% of the polls, as the old hardcoded load
+    case TRAFFIC_MODEL_POISSON: return 20;  // 0.2 readings per poll
+    case TRAFFIC_MODEL_BURSTY: return 5;
+    default: return 0;
+  }
+}
+
+/* Compute e^(-param/100) in Q16 with the Taylor series of e^(param/100)
+   (no floating point on the motes)
+*/
+static uint32_t exp_neg_q16(uint8_t p){
+  uint32_t term = 65536;
+  uint32_t sum = 65536;
+  for(uint8_t k = 1; k < 20 && term > 0; k++){
+    term = term * p / (100UL * k);
+    sum += term;
+  }
+  return 0xFFFFFFFFUL / sum;
+}
+
+void traffic_set_model(uint8_t m, uint8_t p){
+  if(m > TRAFFIC_MODEL_TRACE){
+    return; // unknown model, keep the current one
+  }
+  model = m;
+  param = p == 0 ? default_param(m) : p;
+  constant_count = 0;
+  burst_on = 0;
+  trace_index = node_seed_id % sizeof(trace); // nodes don't replay the trace in lockstep
+  if(model == TRAFFIC_MODEL_POISSON){
+    poisson_exp_neg = exp_neg_q16(param);
+  }
+}
+
+void traffic_init(uint16_t id){
+  // Mix the node id into the seed so that every node gets its own sequence
+  prng_state = (uint32_t)TRAFFIC_SEED ^ ((uint32_t)(id + 1) * 2654435761UL);
+  if(prng_state == 0){
+    prng_state = 1; // xorshift is stuck on 0
+  }
+  node_seed_id = id;
+  traffic_set_model(TRAFFIC_MODEL, TRAFFIC_PARAM);
+}
+
+uint8_t traffic_get_model(){
+  return model;
+}
+
+uint8_t traffic_get_param(){
+  return param;
+}
+
+/* Return the number of readings to send for this poll (0 to TRAFFIC_MAX_PER_POLL) */
+uint8_t traffic_poll(){
+  uint8_t n = 0;
+  switch(model){
+    case TRAFFIC_MODEL_CONSTANT:
+      constant_count++;
+      if(constant_count >= param){
+        constant_count = 0;
+        n = 1;
+      }
+      break;
+    case TRAFFIC_MODEL_POISSON: {
+      // Inversion of the cumulative distribution: P(k+1) = P(k) * lambda / (k+1)
+      uint32_t u = prng_next16();
+      uint32_t p = poisson_exp_neg;
+      uint32_t cdf = p;
+      while(u >= cdf && n < TRAFFIC_MAX_PER_POLL){
+        n++;
+        p = p * param / (100UL * n);
+        cdf += p;
+      }
+      break;
+    }
+    case TRAFFIC_MODEL_BURSTY:
+      // Two states Markov source, the state changes with probability 1/mean_length at each poll
+      if(burst_on){
+        n = 1;
+        if(prng_next16() % param == 0){
+          burst_on = 0;
+        }
+      }
+      else if(prng_next16() % TRAFFIC_BURST_OFF == 0){
+        burst_on = 1;
+      }
+      break;
+    case TRAFFIC_MODEL_TRACE:
+      n = trace[trace_index];
+      trace_index = (trace_index + 1) % sizeof(trace);
+      break;
+  }
+  return n > TRAFFIC_MAX_PER_POLL ? TRAFFIC_MAX_PER_POLL : n;
+}
+
+/* Value of a reading, between 0 and 100 */
+uint8_t traffic_value(){
+  return prng_next16() % 101;
+}
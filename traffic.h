@@ -0,0 +1,60 @@
+#ifndef H_traffic
+#define H_traffic
+#include "contiki.h"
+
+/* TRAFFIC MODELS
+   The parameter meaning depends on the model (0 selects the model default)
+*/
+#define TRAFFIC_MODEL_CONSTANT 0 // one reading every <param> polls
+#define TRAFFIC_MODEL_POISSON  1 // Poisson arrivals, <param> readings per 100 polls on average
+#define TRAFFIC_MODEL_BURSTY   2 // on/off source, <param> = mean burst length in polls
+#define TRAFFIC_MODEL_TRACE    3 // replay of TRAFFIC_TRACE (readings per poll), <param> is ignored
+
+/* BUILD TIME CONFIGURATION (can be set from the Makefile, see README) */
+#ifdef TRAFFIC_CONF_MODEL
+#define TRAFFIC_MODEL TRAFFIC_CONF_MODEL
+#else
+#define TRAFFIC_MODEL TRAFFIC_MODEL_POISSON
+#endif
+
+#ifdef TRAFFIC_CONF_PARAM
+#define TRAFFIC_PARAM TRAFFIC_CONF_PARAM
+#else
+#define TRAFFIC_PARAM 0
+#endif
+
+// Same seed => same sequence of readings for a given node, across runs
+#ifdef TRAFFIC_CONF_SEED
+#define TRAFFIC_SEED TRAFFIC_CONF_SEED
+#else
+#define TRAFFIC_SEED 0x2023
+#endif
+
+// Upper bound of readings generated on a single poll
+#ifdef TRAFFIC_CONF_MAX_PER_POLL
+#define TRAFFIC_MAX_PER_POLL TRAFFIC_CONF_MAX_PER_POLL
+#else
+#define TRAFFIC_MAX_PER_POLL 4
+#endif
+
+// Mean length (in polls) of the silent period of the bursty model
+#ifdef TRAFFIC_CONF_BURST_OFF
+#define TRAFFIC_BURST_OFF TRAFFIC_CONF_BURST_OFF
+#else
+#define TRAFFIC_BURST_OFF 20
+#endif
+
+// Readings per poll replayed in loop by the trace model
+#ifdef TRAFFIC_CONF_TRACE
+#define TRAFFIC_TRACE TRAFFIC_CONF_TRACE
+#else
+#define TRAFFIC_TRACE {0, 1, 0, 0, 2, 0, 1, 0, 0, 0, 3, 1, 0, 0, 0, 0}
+#endif
+
+void traffic_init(uint16_t id);
+void traffic_set_model(uint8_t model, uint8_t param);
+uint8_t traffic_get_model(void);
+uint8_t traffic_get_param(void);
+uint8_t traffic_poll(void);
+uint8_t traffic_value(void);
+#endif